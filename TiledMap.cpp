@@ -0,0 +1,168 @@
+#include "tiledMap.hpp"
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+static const size_t maxPendingSegments = 1 << 16; //buffered segments of all tiles before writing to files
+
+TiledTrapezoidalMap::TiledTrapezoidalMap(const Point& bl, const Point& tr, int n, const std::string& dir, size_t memoryBudget, TileFiles files)
+	: bl(bl), tr(tr), files(files), budget(memoryBudget), resident(0), pendingSegments(0) {
+	assert(n > 0);
+	width = (tr.x - bl.x) / n;
+	tiles.resize(n);
+	for (int i = 0; i < n; i++) {
+		Tile& tile = tiles[i];
+		tile.path = dir + "/tile" + std::to_string(i) + ".bin";
+		tile.segments = 0;
+		tile.map = NULL;
+		if (files == TILES_OPEN) {
+			std::ifstream in(tile.path, std::ios::binary | std::ios::ate);
+			if (!in) throw std::runtime_error("cannot open " + tile.path);
+			tile.segments = (size_t)in.tellg() / (4 * sizeof(double));
+			continue;
+		}
+		std::ofstream out(tile.path, std::ios::binary | std::ios::trunc);
+		if (!out) throw std::runtime_error("cannot create " + tile.path);
+	}
+}
+
+TiledTrapezoidalMap::~TiledTrapezoidalMap() {
+	if (files != TILES_SCRATCH) {
+		try {
+			flushAll();
+		}
+		catch (const std::exception& e) {
+			std::cerr << "tiled map : " << e.what() << '\n';
+		}
+	}
+	for (Tile& tile : tiles) {
+		delete tile.map;
+		if (files == TILES_SCRATCH) std::remove(tile.path.c_str());
+	}
+}
+
+void TiledTrapezoidalMap::sync() {
+	flushAll();
+}
+
+int TiledTrapezoidalMap::tileOf(double x) const {
+	int i = (int)((x - bl.x) / width);
+	return std::min(std::max(i, 0), (int)tiles.size() - 1);
+}
+
+int TiledTrapezoidalMap::residentTiles() const {
+	return (int)lru.size();
+}
+
+size_t TiledTrapezoidalMap::residentBytes() const {
+	return resident;
+}
+
+//a map of n segments has at most 3n+1 trapezoids, each with a leaf, and about 3 internal nodes per segment
+size_t TiledTrapezoidalMap::estimateBytes(size_t segments) {
+	return (3 * segments + 1) * (sizeof(Trapezoid) + sizeof(LeafNode) + 4 * sizeof(TNode**))
+		+ segments * (2 * sizeof(XNode) + sizeof(YNode));
+}
+
+void TiledTrapezoidalMap::insert(const Line& l) {
+	int from = tileOf(l.pl.x), to = tileOf(l.pr.x);
+	for (int i = from; i <= to; i++) {
+		Tile& tile = tiles[i];
+		tile.pending.push_back(l);
+		tile.segments++;
+		pendingSegments++;
+		if (tile.map != NULL) {
+			tile.map->insert(l);
+			resident += estimateBytes(tile.segments) - estimateBytes(tile.segments - 1);
+			shrink(i, 0);
+		}
+	}
+	if (pendingSegments >= maxPendingSegments) flushAll();
+}
+
+void TiledTrapezoidalMap::flush(Tile& tile) {
+	if (tile.pending.empty()) return;
+	std::ofstream out(tile.path, std::ios::binary | std::ios::app);
+	if (!out) throw std::runtime_error("cannot open " + tile.path);
+	for (const Line& l : tile.pending) {
+		double v[4] = { l.pl.x, l.pl.y, l.pr.x, l.pr.y };
+		out.write((const char*)v, sizeof(v));
+	}
+	if (!out) throw std::runtime_error("cannot write " + tile.path);
+	pendingSegments -= tile.pending.size();
+	tile.pending.clear();
+	tile.pending.shrink_to_fit();
+}
+
+void TiledTrapezoidalMap::flushAll() {
+	for (Tile& tile : tiles) flush(tile);
+}
+
+void TiledTrapezoidalMap::evict(int i) {
+	Tile& tile = tiles[i];
+	lru.erase(tile.lru);
+	resident -= estimateBytes(tile.segments);
+	delete tile.map;
+	tile.map = NULL;
+}
+
+//evicts least recently used tiles other than keep until extra more bytes fit in the budget
+void TiledTrapezoidalMap::shrink(int keep, size_t extra) {
+	std::list<int>::iterator it = lru.end();
+	while (resident + extra > budget && it != lru.begin()) {
+		--it;
+		if (*it == keep) continue;
+		int victim = *it;
+		++it; //stays valid when the victim is erased
+		evict(victim);
+	}
+}
+
+TrapezoidalMap* TiledTrapezoidalMap::load(int i) {
+	Tile& tile = tiles[i];
+	if (tile.map != NULL) {
+		lru.splice(lru.begin(), lru, tile.lru);
+		return tile.map;
+	}
+
+	size_t bytes = estimateBytes(tile.segments);
+	shrink(i, bytes);
+
+	flush(tile);
+	std::ifstream in(tile.path, std::ios::binary);
+	if (!in) throw std::runtime_error("cannot open " + tile.path);
+	std::vector<Line> lines;
+	lines.reserve(tile.segments);
+	double v[4];
+	while (in.read((char*)v, sizeof(v))) {
+		lines.push_back(Line(Point(v[0], v[1]), Point(v[2], v[3])));
+	}
+
+	//files keep insertion order, which is often sorted by x and gives linear depth
+	//a fixed seed keeps the rebuilt map, and so its latency, the same on every load
+	std::mt19937 gen(i);
+	std::shuffle(lines.begin(), lines.end(), gen);
+	TrapezoidalMap* map = new TrapezoidalMap(bl, tr);
+	for (const Line& l : lines) {
+		map->insert(l);
+	}
+
+	tile.map = map;
+	lru.push_front(i);
+	tile.lru = lru.begin();
+	resident += bytes;
+	return map;
+}
+
+Trapezoid* TiledTrapezoidalMap::query(const Point& p) {
+	return load(tileOf(p.x))->query(p);
+}
+
+const Line* TiledTrapezoidalMap::segmentAbove(const Point& p) {
+	return load(tileOf(p.x))->segmentAbove(p);
+}
+
+const Line* TiledTrapezoidalMap::segmentBelow(const Point& p) {
+	return load(tileOf(p.x))->segmentBelow(p);
+}
@@ -1,9 +1,20 @@
 #include "trapezoidalMap.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-
-bool Point::isLeft(const Point& p) const {
-	return x < p.x;
+static unsigned long long profileTick() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
 }
+
+
 bool Point::isSame(const Point& p) const {
 	return std::abs(x - p.x) < eps && std::abs(y - p.y) < eps;
 }
@@ -33,10 +44,6 @@ Line::Line(const Point& pl_, const Point& pr_) {
 	pl = pl_, pr = pr_;
 	if (pr.isLeft(pl)) std::swap(pl, pr);
 }
-bool Line::isUpper(const Point& p) const {
-	Point t1 = pr - pl, t2 = p - pl;
-	return (t1.x * t2.y - t1.y * t2.x) < eps;
-}
 std::ostream& operator<<(std::ostream& o, const Line& l) {
 	o <<"[ "<<l.pl << " -> " << l.pr << " ]";
 	return o;
@@ -47,45 +54,39 @@ bool Line::IsPtEndpoint(const Point& p) const {
 	return pl.isSame(p) || pr.isSame(p);
 }
 
-
-bool XNode::isLeaf() const {
-	return false;
-}
-TNode* XNode::query(const Point& pt) {
-	return p.isLeft(pt) ? rc : lc;
+double Line::yAt(double x) const {
+	return pl.y + (pr.y - pl.y) * (x - pl.x) / (pr.x - pl.x);
 }
 
 
-bool YNode::isLeaf() const{
-	return false;
-}
-TNode* YNode::query(const Point& pt) {
-	return l.isUpper(pt) ? rc : lc;
+void TNode::destroy(TNode* node) {
+	switch (node->type) {
+	case XNODE: delete (XNode*)node; break;
+	case YNODE: delete (YNode*)node; break;
+	case LEAFNODE: delete (LeafNode*)node; break;
+	}
 }
 
-LeafNode::LeafNode(Trapezoid* t_) {
+LeafNode::LeafNode(Trapezoid* t_) : TNode(LEAFNODE) {
 	t = t_;
 	t_->node = this;
-	lc = rc = NULL;
-}
-
-bool LeafNode::isLeaf() const{
-	return true;
-}
-TNode* LeafNode::query(const Point& pt) {
-	return this;
 }
 
 Trapezoid::Trapezoid(Line top, Line bottom, Point leftp, Point rightp) : top(top), bottom(bottom), leftp(leftp), rightp(rightp) {
 	lowerleft = upperleft = lowerright = upperright = NULL;
 }
 
-bool Trapezoid::isInside(const Point& pt) {
+bool Trapezoid::isInside(const Point& pt) const {
 	return top.isUpper(pt)
 		&& !bottom.isUpper(pt)
 		&& leftp.isLeft(pt)
 		&& !rightp.isLeft(pt);
 }
+double Trapezoid::area() const {
+	double hl = top.yAt(leftp.x) - bottom.yAt(leftp.x);
+	double hr = top.yAt(rightp.x) - bottom.yAt(rightp.x);
+	return (rightp.x - leftp.x) * (hl + hr) / 2;
+}
 void Trapezoid::updateLeftTrapezoid(Trapezoid* prv, Trapezoid* cur) {
 	if (lowerleft == prv) lowerleft = cur;
 	if (upperleft == prv) upperleft = cur;
@@ -103,7 +104,7 @@ std::ostream& operator<<(std::ostream& o, const Trapezoid& t) {
 }
 
 
-int TrapezoidalMap::maxDepth() {
+int TrapezoidalMap::maxDepth() const {
 	std::set<TNode*> occur;
 	std::map<TNode*, int> dep;
 	std::map<TNode*, int> inedges;
@@ -113,15 +114,15 @@ int TrapezoidalMap::maxDepth() {
 		TNode* cur = q.front();
 		q.pop();
 		if (cur->isLeaf()) continue;
-		inedges[cur->lc] += 1;
-		if (occur.find(cur->lc) == occur.end()) {
-			q.push(cur->lc);
-			occur.insert(cur->lc);
+		inedges[cur->child[0]] += 1;
+		if (occur.find(cur->child[0]) == occur.end()) {
+			q.push(cur->child[0]);
+			occur.insert(cur->child[0]);
 		}
-		inedges[cur->rc] += 1;
-		if (occur.find(cur->rc) == occur.end()) {
-			q.push(cur->rc);
-			occur.insert(cur->rc);
+		inedges[cur->child[1]] += 1;
+		if (occur.find(cur->child[1]) == occur.end()) {
+			q.push(cur->child[1]);
+			occur.insert(cur->child[1]);
 		}
 	}
 
@@ -136,19 +137,50 @@ int TrapezoidalMap::maxDepth() {
 			continue;
 		}
 
-		if ((--inedges[cur->lc]) == 0) 
-			q.push(cur->lc);
-		dep[cur->lc] = std::max(dep[cur->lc], cdep + 1);
+		if ((--inedges[cur->child[0]]) == 0) 
+			q.push(cur->child[0]);
+		dep[cur->child[0]] = std::max(dep[cur->child[0]], cdep + 1);
 
 		
-		if ((--inedges[cur->rc]) == 0) 
-			q.push(cur->rc);
-		dep[cur->rc] = std::max(dep[cur->rc], cdep + 1);
+		if ((--inedges[cur->child[1]]) == 0) 
+			q.push(cur->child[1]);
+		dep[cur->child[1]] = std::max(dep[cur->child[1]], cdep + 1);
 	}
 	return maxDepth;
 }
 
-TrapezoidalMap::TrapezoidalMap(const Point& bl, const Point& tr) {
+BuildProfile::BuildProfile() {
+	queryCycles = walkCycles = splitCycles = rewireCycles = 0;
+	segments = trapezoidAllocs = nodeAllocs = 0;
+}
+
+int BuildProfile::maxCrossed() const {
+	return crossed.empty() ? 0 : *std::max_element(crossed.begin(), crossed.end());
+}
+
+double BuildProfile::avgCrossed() const {
+	double sum = 0;
+	for (int k : crossed) sum += k;
+	return crossed.empty() ? 0.0 : sum / crossed.size();
+}
+
+std::ostream& operator<<(std::ostream& o, const BuildProfile& p) {
+	unsigned long long total = p.queryCycles + p.walkCycles + p.splitCycles + p.rewireCycles;
+	double div = total == 0 ? 1.0 : total / 100.0;
+	o << "segments : " << p.segments << '\n';
+	o << "query cycles : " << p.queryCycles << " (" << p.queryCycles / div << "%)\n";
+	o << "walk cycles : " << p.walkCycles << " (" << p.walkCycles / div << "%)\n";
+	o << "split cycles : " << p.splitCycles << " (" << p.splitCycles / div << "%)\n";
+	o << "rewire cycles : " << p.rewireCycles << " (" << p.rewireCycles / div << "%)\n";
+	o << "crossed trapezoids avg : " << p.avgCrossed() << " max : " << p.maxCrossed() << '\n';
+	o << "trapezoid allocs : " << p.trapezoidAllocs << '\n';
+	o << "node allocs : " << p.nodeAllocs << '\n';
+	return o;
+}
+
+
+TrapezoidalMap::TrapezoidalMap(const Point& bl, const Point& tr) : bottomLeft(bl), topRight(tr), version(0) {
+	profile = NULL;
 	Point br(tr.x, bl.y), tl(bl.x, tr.y);
 
 	Trapezoid* t = new Trapezoid(Line(tl,tr), Line(bl, br), bl,tr);
@@ -158,70 +190,390 @@ TrapezoidalMap::TrapezoidalMap(const Point& bl, const Point& tr) {
 	leaf->parents.push_back(&root);
 }
 
+TrapezoidalMap::TrapezoidalMap(const TrapezoidalMap& o) : version(0) {
+	profile = NULL;
+	copyFrom(o);
+}
+
+//the copy is built before anything of this map is touched, so a throwing allocation leaves this map as it was
+TrapezoidalMap& TrapezoidalMap::operator=(const TrapezoidalMap& o) {
+	if (this == &o) return *this;
+	TrapezoidalMap copy(o);
+	swap(copy);
+	return *this;
+}
+
+//exchanges the structures, the profile stays with the map it was attached to
+void TrapezoidalMap::swap(TrapezoidalMap& o) {
+	root = o.root.exchange(root);
+	version = o.version.exchange(version);
+	std::swap(bottomLeft, o.bottomLeft);
+	std::swap(topRight, o.topRight);
+	std::swap(retired, o.retired);
+	//a root leaf keeps the address of the root slot it hangs from
+	if (root.load()->isLeaf()) ((LeafNode*)root.load())->parents.assign(1, &root);
+	if (o.root.load()->isLeaf()) ((LeafNode*)o.root.load())->parents.assign(1, &o.root);
+}
+
 TrapezoidalMap::~TrapezoidalMap() {
-	
+	clear();
+}
+
+void TrapezoidalMap::clear() {
+	std::set<TNode*> occur;
+	std::queue<TNode*> q;
+	q.push(root); occur.insert(root);
+	while (!q.empty()) {
+		TNode* cur = q.front();
+		q.pop();
+		if (cur->isLeaf()) continue;
+		if (occur.find(cur->child[0]) == occur.end()) {
+			q.push(cur->child[0]);
+			occur.insert(cur->child[0]);
+		}
+		if (occur.find(cur->child[1]) == occur.end()) {
+			q.push(cur->child[1]);
+			occur.insert(cur->child[1]);
+		}
+	}
+	for (TNode* tmp : occur) {
+		if (tmp->isLeaf()) delete ((LeafNode*)tmp)->t; //each trapezoid is owned by its leaf
+		TNode::destroy(tmp);
+	}
+	for (auto& r : retired) {
+		delete r.second->t;
+		TNode::destroy(r.second);
+	}
+	retired.clear();
+	root = NULL;
+}
+
+//on a throwing allocation the clones made so far are freed and the exception is passed on
+void TrapezoidalMap::copyFrom(const TrapezoidalMap& o) {
+	bottomLeft = o.bottomLeft;
+	topRight = o.topRight;
+	std::unordered_map<TNode*, TNode*> nodes;
+	std::unordered_map<Trapezoid*, Trapezoid*> traps;
+	std::vector<TNode*> order;
+	std::queue<TNode*> q;
+
+	try {
+		//clone every node and trapezoid, links are fixed below once all clones exist
+		q.push(o.root);
+		nodes[o.root] = NULL;
+		while (!q.empty()) {
+			TNode* cur = q.front();
+			q.pop();
+			order.push_back(cur);
+			if (cur->isLeaf()) {
+				Trapezoid*& t = traps[((LeafNode*)cur)->t];
+				t = new Trapezoid(*((LeafNode*)cur)->t);
+				nodes[cur] = new LeafNode(t);
+				continue;
+			}
+			if (cur->type == XNODE) nodes[cur] = new XNode(((XNode*)cur)->p);
+			else nodes[cur] = new YNode(((YNode*)cur)->l);
+			for (TNode* c : cur->child) {
+				if (nodes.find(c) == nodes.end()) {
+					q.push(c);
+					nodes[c] = NULL;
+				}
+			}
+		}
+
+		root = nodes[o.root];
+		if (root.load()->isLeaf()) ((LeafNode*)root.load())->parents.push_back(&root);
+		for (TNode* cur : order) {
+			TNode* n = nodes[cur];
+			if (cur->isLeaf()) {
+				Trapezoid* t = ((LeafNode*)n)->t;
+				t->upperleft = t->upperleft == NULL ? NULL : traps[t->upperleft];
+				t->lowerleft = t->lowerleft == NULL ? NULL : traps[t->lowerleft];
+				t->upperright = t->upperright == NULL ? NULL : traps[t->upperright];
+				t->lowerright = t->lowerright == NULL ? NULL : traps[t->lowerright];
+				continue;
+			}
+			for (int i = 0; i < 2; i++) {
+				TNode* c = nodes[cur->child[i]];
+				n->child[i] = c;
+				if (c->isLeaf()) ((LeafNode*)c)->parents.push_back(&n->child[i]);
+			}
+		}
+	}
+	catch (...) {
+		for (auto& t : traps) delete t.second;
+		for (auto& n : nodes) {
+			if (n.second != NULL) TNode::destroy(n.second);
+		}
+		throw;
+	}
+}
+
+void TrapezoidalMap::nodes(std::vector<TNode*>& out) const {
 	std::set<TNode*> occur;
 	std::queue<TNode*> q;
 	q.push(root); occur.insert(root);
 	while (!q.empty()) {
 		TNode* cur = q.front();
 		q.pop();
+		out.push_back(cur);
 		if (cur->isLeaf()) continue;
-		if (occur.find(cur->lc) == occur.end()) {
-			q.push(cur->lc);
-			occur.insert(cur->lc);
+		if (occur.find(cur->child[0]) == occur.end()) {
+			q.push(cur->child[0]);
+			occur.insert(cur->child[0]);
+		}
+		if (occur.find(cur->child[1]) == occur.end()) {
+			q.push(cur->child[1]);
+			occur.insert(cur->child[1]);
+		}
+	}
+}
+
+void TrapezoidalMap::leaves(std::vector<LeafNode*>& out) const {
+	std::vector<TNode*> all;
+	nodes(all);
+	for (TNode* cur : all) {
+		if (cur->isLeaf()) out.push_back((LeafNode*)cur);
+	}
+}
+
+/*
+Checks
+1. every leaf is reachable : a point in the middle of its trapezoid is answered with that leaf
+2. the parents of a leaf are exactly the edges into it. A leaf may have more than 4 parents,
+   a trapezoid merged along a new segment gets one parent per trapezoid it replaced
+3. neighbor links are symmetric and only name trapezoids of the map
+4. the trapezoids tile the bounding box : positive width and height, inside the box, neighbors share the
+   vertical side between them, areas sum to the box area
+*/
+bool TrapezoidalMap::checkInvariants(std::string& error) const {
+	std::ostringstream o;
+	std::vector<TNode*> dag;
+	std::vector<LeafNode*> all;
+	std::map<LeafNode*, std::set<NodeSlot*>> edges;
+	nodes(dag);
+	if (root.load()->isLeaf()) edges[(LeafNode*)root.load()].insert((NodeSlot*)&root);
+	for (TNode* cur : dag) {
+		if (cur->isLeaf()) {
+			all.push_back((LeafNode*)cur);
+			continue;
+		}
+		for (NodeSlot& c : cur->child) {
+			if (c.load()->isLeaf()) edges[(LeafNode*)c.load()].insert(&c);
+		}
+	}
+	std::set<Trapezoid*> traps;
+	for (LeafNode* leaf : all) traps.insert(leaf->t);
+
+	double sum = 0;
+	for (LeafNode* leaf : all) {
+		Trapezoid* t = leaf->t;
+		if (t->node != leaf) o << "trapezoid does not point to its leaf\n";
+		if (std::set<NodeSlot*>(leaf->parents.begin(), leaf->parents.end()) != edges[leaf] || leaf->parents.size() != edges[leaf].size()) {
+			o << "leaf has " << leaf->parents.size() << " parents but " << edges[leaf].size() << " edges into it\n";
+		}
+
+		if (!t->leftp.isLeft(t->rightp)) o << "leftp is not left of rightp\n";
+		else {
+			double x = (t->leftp.x + t->rightp.x) / 2;
+			Point mid(x, (t->top.yAt(x) + t->bottom.yAt(x)) / 2);
+			if (queryNode(mid) != leaf) o << "leaf is not reachable by " << mid << '\n';
+		}
+		if (t->leftp.isLeft(bottomLeft) || topRight.isLeft(t->rightp)) o << "trapezoid is outside of the box\n";
+		for (double x : { t->leftp.x, t->rightp.x }) {
+			double top = t->top.yAt(x), bottom = t->bottom.yAt(x);
+			if (top > topRight.y + eps || bottom < bottomLeft.y - eps) o << "trapezoid is outside of the box at x = " << x << '\n';
+			if (bottom > top + eps) o << "bottom is above top at x = " << x << '\n';
 		}
-		if (occur.find(cur->rc) == occur.end()) {
-			q.push(cur->rc);
-			occur.insert(cur->rc);
+		sum += t->area();
+
+		Trapezoid* right[2] = { t->upperright, t->lowerright };
+		Trapezoid* left[2] = { t->upperleft, t->lowerleft };
+		for (Trapezoid* n : right) {
+			if (n == NULL) continue;
+			if (traps.find(n) == traps.end()) o << "right neighbor is not in the map\n";
+			else if (n->upperleft != t && n->lowerleft != t) o << "right neighbor does not link back\n";
+			else if (std::abs(n->leftp.x - t->rightp.x) >= eps) o << "right neighbor does not start at rightp\n";
 		}
+		for (Trapezoid* n : left) {
+			if (n == NULL) continue;
+			if (traps.find(n) == traps.end()) o << "left neighbor is not in the map\n";
+			else if (n->upperright != t && n->lowerright != t) o << "left neighbor does not link back\n";
+			else if (std::abs(n->rightp.x - t->leftp.x) >= eps) o << "left neighbor does not end at leftp\n";
+		}
+
+		if (!o.str().empty()) {
+			o << *t;
+			error = o.str();
+			return false;
+		}
+	}
+
+	double box = (topRight.x - bottomLeft.x) * (topRight.y - bottomLeft.y);
+	if (std::abs(sum - box) > 1e-9 * box) {
+		o << "trapezoid areas sum to " << sum << " instead of " << box << '\n';
+		error = o.str();
+		return false;
 	}
-	for (TNode* tmp : occur) delete tmp; //only nodes are allocated in heap
+	return true;
 }
 
-LeafNode* TrapezoidalMap::queryNode(const Point& p) {
+LeafNode* TrapezoidalMap::queryNode(const Point& p) const {
 	TNode* cur = root;
 	while (!cur->isLeaf()) {
-		cur = cur->query(p);
+		bool right = cur->type == XNODE
+			? ((XNode*)cur)->p.isLeft(p)
+			: ((YNode*)cur)->l.isUpper(p);
+		cur = (right ? cur->child[1] : cur->child[0]).load(std::memory_order_relaxed); //only insert writes the slots
 	}
 
 	return (LeafNode*)cur;
 }
 
+int TrapezoidalMap::queryDepth(const Point& p) const {
+	int depth = 0;
+	TNode* cur = root;
+	while (!cur->isLeaf()) {
+		cur = cur->query(p);
+		depth++;
+	}
+	return depth;
+}
 
 Trapezoid* TrapezoidalMap::query(const Point& p) {
 	return queryNode(p)->t;
 }
 
+const Trapezoid* TrapezoidalMap::query(const Point& p) const {
+	return queryNode(p)->t;
+}
+
+bool TrapezoidalMap::isBoundary(const Line& l) const {
+	Point tl(bottomLeft.x, topRight.y), br(topRight.x, bottomLeft.y);
+	return (l.pl.isSame(tl) && l.pr.isSame(topRight)) || (l.pl.isSame(bottomLeft) && l.pr.isSame(br));
+}
+
+const Line* TrapezoidalMap::segmentAbove(const Point& p) const {
+	const Trapezoid* t = query(p);
+	return isBoundary(t->top) ? NULL : &t->top;
+}
+
+const Line* TrapezoidalMap::segmentBelow(const Point& p) const {
+	const Trapezoid* t = query(p);
+	return isBoundary(t->bottom) ? NULL : &t->bottom;
+}
+
+//the trapezoid at the left side of the box, no segment endpoint is left of it so the descent only meets XNodes
+const Trapezoid* TrapezoidalMap::leftmost() const {
+	return queryNode(Point(bottomLeft.x, (bottomLeft.y + topRight.y) / 2))->t;
+}
+
+//count, then one trapezoid per line : top, bottom, leftp, rightp as 12 numbers
+//streamed in two walks of forEachTrapezoid, the first one only counts
+void TrapezoidalMap::exportDecomposition(std::ostream& o) const {
+	size_t count = 0;
+	forEachTrapezoid([&](const Trapezoid&) { count++; });
+	std::streamsize precision = o.precision(17);
+	o << count << '\n';
+	forEachTrapezoid([&](const Trapezoid& t) {
+		o << t.top.pl.x << ' ' << t.top.pl.y << ' ' << t.top.pr.x << ' ' << t.top.pr.y << ' ';
+		o << t.bottom.pl.x << ' ' << t.bottom.pl.y << ' ' << t.bottom.pr.x << ' ' << t.bottom.pr.y << ' ';
+		o << t.leftp.x << ' ' << t.leftp.y << ' ' << t.rightp.x << ' ' << t.rightp.y << '\n';
+	});
+	o.precision(precision);
+}
+
+void TrapezoidalMap::setProfile(BuildProfile* p) {
+	profile = p;
+}
+
+void TrapezoidalMap::lap(unsigned long long BuildProfile::* phase, unsigned long long& mark) {
+	if (profile == NULL) return;
+	unsigned long long now = profileTick();
+	profile->*phase += now - mark;
+	mark = now;
+}
+
+void TrapezoidalMap::countAllocs(int trapezoids, int nodes) {
+	if (profile == NULL) return;
+	profile->trapezoidAllocs += trapezoids;
+	profile->nodeAllocs += nodes;
+}
+
 void TrapezoidalMap::insert(const Line& l) {
 	//Point dl = ((l.pr - l.pl).normalize()) * eps;
 	const Point& pl = l.pl;
 	const Point& pr = l.pr;
+	unsigned long long mark = profile == NULL ? 0 : profileTick();
+	int crossed = 1;
 
 	Trapezoid* tl = query(pl), * ntl;
 	Trapezoid* Y = NULL, *Z = NULL;
+	lap(&BuildProfile::queryCycles, mark);
 	if (tl->isInside(pr)) {
+		lap(&BuildProfile::walkCycles, mark);
 		insert_two_segment_endpoint(tl, l);
-		return;
+		lap(&BuildProfile::splitCycles, mark);
 	}
+	else {
+		ntl = nextTrapezoid(tl, l);
+		lap(&BuildProfile::walkCycles, mark);
+		insert_left_endpoint(tl, l, Y, Z);
+		lap(&BuildProfile::splitCycles, mark);
+		tl = ntl;
 
-	ntl = nextTrapezoid(tl, l);
-	insert_left_endpoint(tl, l, Y, Z);
-	tl = ntl;
+		while (!tl->isInside(pr)) {
+			ntl = nextTrapezoid(tl, l);
+			lap(&BuildProfile::walkCycles, mark);
+			insert_no_segment_endpoint(tl, l, Y, Z);
+			lap(&BuildProfile::splitCycles, mark);
 
-	while (!tl->isInside(pr)) {
-		ntl = nextTrapezoid(tl, l);
-		insert_no_segment_endpoint(tl, l, Y, Z);
+			tl = ntl;
+			crossed++;
+		}
+		lap(&BuildProfile::walkCycles, mark);
+		insert_right_endpint(tl, l, Y, Z);
+		lap(&BuildProfile::splitCycles, mark);
+		crossed++;
+	}
 
-		tl = ntl;
+#ifdef TM_CHECK_INVARIANTS
+	std::string error;
+	if (!checkInvariants(error)) {
+		std::cerr << "invariant broken after inserting " << l << " : " << error << '\n';
+		std::abort(); //not assert, the check must stop release builds too
 	}
-	insert_right_endpint(tl, l, Y, Z);
+#endif
+
+	version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	reclaim();
 
+	if (profile != NULL) {
+		profile->segments++;
+		profile->crossed.push_back(crossed);
+	}
 	return;
 }
 
+//points every parent of leaf to node, the time is moved from split to rewire
+//node is complete before it is published, readers of older versions step from it back to leaf
+void TrapezoidalMap::replaceLeaf(LeafNode* leaf, TNode* node) {
+	unsigned long long start = profile == NULL ? 0 : profileTick();
+	node->version = version.load(std::memory_order_relaxed) + 1;
+	node->replaced = leaf;
+	for (NodeSlot* tmp : leaf->parents) {
+		tmp->store(node, std::memory_order_release);
+	}
+	if (profile != NULL) {
+		unsigned long long spent = profileTick() - start;
+		profile->rewireCycles += spent;
+		profile->splitCycles -= spent;
+	}
+}
+
 void TrapezoidalMap::insert_two_segment_endpoint(Trapezoid* A, const Line& s) 
 {
+	countAllocs(4, 7);
 	const Point& p = s.pl, & q = s.pr;
 
 	Trapezoid* U = new Trapezoid(A->top, A->bottom, A->leftp, p);
@@ -253,26 +605,25 @@ void TrapezoidalMap::insert_two_segment_endpoint(Trapezoid* A, const Line& s)
 	LeafNode* Ynode = new LeafNode(Y);
 	LeafNode* Znode = new LeafNode(Z);
 
-	pnode->lc = Unode;
-	pnode->rc = qnode;
-	qnode->lc = snode;
-	qnode->rc = Xnode;
-	snode->lc = Ynode;
-	snode->rc = Znode;
-
-	Unode->parents.push_back(&pnode->lc);
-	Xnode->parents.push_back(&qnode->rc);
-	Ynode->parents.push_back(&snode->lc);
-	Znode->parents.push_back(&snode->rc);
-	for (TNode** tmp: originalNode->parents) {
-		*tmp = pnode;
-	}
+	//the new nodes are only reachable once replaceLeaf publishes pnode, their links need no ordering
+	pnode->child[0].store(Unode, std::memory_order_relaxed);
+	pnode->child[1].store(qnode, std::memory_order_relaxed);
+	qnode->child[0].store(snode, std::memory_order_relaxed);
+	qnode->child[1].store(Xnode, std::memory_order_relaxed);
+	snode->child[0].store(Ynode, std::memory_order_relaxed);
+	snode->child[1].store(Znode, std::memory_order_relaxed);
+
+	Unode->parents.push_back(&pnode->child[0]);
+	Xnode->parents.push_back(&qnode->child[1]);
+	Ynode->parents.push_back(&snode->child[0]);
+	Znode->parents.push_back(&snode->child[1]);
+	replaceLeaf(originalNode, pnode);
 	
-	delete originalNode;
-	delete A;
+	retire(originalNode);
 }
 
 void TrapezoidalMap::insert_left_endpoint(Trapezoid* A, const Line& s, Trapezoid*& pY, Trapezoid*& pZ) {
+	countAllocs(3, 5);
 	const Point& p = s.pl, &q = s.pr;
 	
 	Trapezoid* X = new Trapezoid(A->top, A->bottom, A->leftp, p);
@@ -326,28 +677,26 @@ void TrapezoidalMap::insert_left_endpoint(Trapezoid* A, const Line& s, Trapezoid
 	LeafNode* Ynode = new LeafNode(Y);
 	LeafNode* Znode = new LeafNode(Z);
 
-	pnode->lc = Xnode;
-	pnode->rc = snode;
-	snode->lc = Ynode;
-	snode->rc = Znode;
+	pnode->child[0].store(Xnode, std::memory_order_relaxed);
+	pnode->child[1].store(snode, std::memory_order_relaxed);
+	snode->child[0].store(Ynode, std::memory_order_relaxed);
+	snode->child[1].store(Znode, std::memory_order_relaxed);
 
-	Xnode->parents.push_back(&pnode->lc);
-	Ynode->parents.push_back(&snode->lc);
-	Znode->parents.push_back(&snode->rc);
+	Xnode->parents.push_back(&pnode->child[0]);
+	Ynode->parents.push_back(&snode->child[0]);
+	Znode->parents.push_back(&snode->child[1]);
 
 
-	for (TNode** tmp : originalNode->parents) {
-		*tmp = pnode;
-	}
+	replaceLeaf(originalNode, pnode);
 
 	pY = Y;
 	pZ = Z;
-	delete originalNode;
-	delete A;
+	retire(originalNode);
 }
 
 
 void TrapezoidalMap::insert_no_segment_endpoint(Trapezoid* A, const Line& s, Trapezoid*& pY, Trapezoid*& pZ) {
+	countAllocs(1, 2);
 	const Point& p = s.pl, & q = s.pr;
 	Trapezoid* Y = s.isUpper(A->leftp) ? pY : new Trapezoid(A->top, s, A->leftp, Point()); //for some case may not know rightp of Y
 	Trapezoid* Z = s.isUpper(A->leftp) ? new Trapezoid(s, A->bottom, A->leftp, Point()) : pZ; //for some case may not know rightp of Z
@@ -403,21 +752,19 @@ void TrapezoidalMap::insert_no_segment_endpoint(Trapezoid* A, const Line& s, Tra
 	LeafNode* Ynode = s.isUpper(A->leftp) ? (LeafNode*)Y->node : new LeafNode(Y);
 	LeafNode* Znode = s.isUpper(A->leftp) ? new LeafNode(Z) : (LeafNode*)Z->node;
 
-	snode->lc = Ynode;
-	snode->rc = Znode;
-	Ynode->parents.push_back(&snode->lc);
-	Znode->parents.push_back(&snode->rc);
+	snode->child[0].store(Ynode, std::memory_order_relaxed);
+	snode->child[1].store(Znode, std::memory_order_relaxed);
+	Ynode->parents.push_back(&snode->child[0]);
+	Znode->parents.push_back(&snode->child[1]);
 
-	for (TNode** tmp : originalNode->parents) {
-		*tmp = snode;
-	}
+	replaceLeaf(originalNode, snode);
 	pY = Y;
 	pZ = Z;
-	delete originalNode;
-	delete A;
+	retire(originalNode);
 }
 
 void TrapezoidalMap::insert_right_endpint(Trapezoid* A, const Line& s, Trapezoid*& pY, Trapezoid*& pZ) {
+	countAllocs(2, 4);
 	const Point& p = s.pl, & q = s.pr;
 
 	Trapezoid* Y = s.isUpper(A->leftp) ? pY : new Trapezoid(A->top, s, A->leftp, q);
@@ -464,26 +811,86 @@ void TrapezoidalMap::insert_right_endpint(Trapezoid* A, const Line& s, Trapezoid
 	LeafNode* Ynode = s.isUpper(A->leftp) ? (LeafNode*)Y->node : new LeafNode(Y);
 	LeafNode* Znode = s.isUpper(A->leftp) ? new LeafNode(Z) : (LeafNode*)Z->node;
 
-	qnode->lc = snode;
-	qnode->rc = Xnode;
-	snode->lc = Ynode;
-	snode->rc = Znode;
+	qnode->child[0].store(snode, std::memory_order_relaxed);
+	qnode->child[1].store(Xnode, std::memory_order_relaxed);
+	snode->child[0].store(Ynode, std::memory_order_relaxed);
+	snode->child[1].store(Znode, std::memory_order_relaxed);
 
-	Xnode->parents.push_back(&qnode->rc);
-	Ynode->parents.push_back(&snode->lc);
-	Znode->parents.push_back(&snode->rc);
+	Xnode->parents.push_back(&qnode->child[1]);
+	Ynode->parents.push_back(&snode->child[0]);
+	Znode->parents.push_back(&snode->child[1]);
 
 
-	for (TNode** tmp : originalNode->parents) {
-		*tmp = qnode;
-	}
+	replaceLeaf(originalNode, qnode);
 
 	pY = Y;
 	pZ = Z;
-	delete originalNode;
-	delete A;
+	retire(originalNode);
+}
+
+//the replaced leaf and its trapezoid are freed by reclaim once no older version is pinned
+void TrapezoidalMap::retire(LeafNode* leaf) {
+	retired.push_back(std::make_pair(version.load(std::memory_order_relaxed) + 1, leaf));
+}
+
+//frees what the inserts up to the oldest pinned version replaced, called after a version is published
+void TrapezoidalMap::reclaim() {
+	unsigned oldest;
+	{
+		std::lock_guard<std::mutex> lock(pinLock);
+		oldest = pins.empty() ? version.load(std::memory_order_relaxed) : *pins.begin();
+	}
+	size_t n = 0;
+	for (; n < retired.size() && retired[n].first <= oldest; n++) {
+		delete retired[n].second->t;
+		TNode::destroy(retired[n].second);
+	}
+	retired.erase(retired.begin(), retired.begin() + n);
+}
+
+unsigned TrapezoidalMap::pin() {
+	std::lock_guard<std::mutex> lock(pinLock);
+	unsigned v = version.load(std::memory_order_acquire);
+	pins.insert(v);
+	return v;
+}
+
+void TrapezoidalMap::unpin(unsigned v) {
+	std::lock_guard<std::mutex> lock(pinLock);
+	pins.erase(pins.find(v));
 }
 
 Trapezoid* TrapezoidalMap::nextTrapezoid(Trapezoid* node, const Line& l) {
 	return l.isUpper(node->rightp) ? node->upperright : node->lowerright;
-}
\ No newline at end of file
+}
+
+
+MapVersion::MapVersion(TrapezoidalMap& map) : map(map), version(map.pin()) {
+}
+
+MapVersion::~MapVersion() {
+	map.unpin(version);
+}
+
+//queryNode on the version : a node newer than the version stands for the leaf it replaced
+const Trapezoid* MapVersion::query(const Point& p) const {
+	const TNode* cur = map.root.load(std::memory_order_acquire);
+	for (;;) {
+		if (cur->version > version) cur = cur->replaced;
+		if (cur->isLeaf()) return ((const LeafNode*)cur)->t;
+		bool right = cur->type == XNODE
+			? ((const XNode*)cur)->p.isLeft(p)
+			: ((const YNode*)cur)->l.isUpper(p);
+		cur = (right ? cur->child[1] : cur->child[0]).load(std::memory_order_acquire);
+	}
+}
+
+const Line* MapVersion::segmentAbove(const Point& p) const {
+	const Trapezoid* t = query(p);
+	return map.isBoundary(t->top) ? NULL : &t->top;
+}
+
+const Line* MapVersion::segmentBelow(const Point& p) const {
+	const Trapezoid* t = query(p);
+	return map.isBoundary(t->bottom) ? NULL : &t->bottom;
+}
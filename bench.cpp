@@ -0,0 +1,92 @@
+#include "trapezoidalMap.hpp"
+#include "input.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+//build time of lines in the given order
+void getBuildTime(const char* name, const std::vector<Line>& lines, double bd) {
+	auto start = std::chrono::high_resolution_clock::now();
+	TrapezoidalMap tm(Point(-bd, -bd), Point(bd, bd));
+	for (const Line& l : lines) {
+		tm.insert(l);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> sec = end - start;
+	std::cout << name << " build : " << lines.size() << " segments " << sec.count() << " s, max depth " << tm.maxDepth() << '\n';
+}
+
+//build of lines with profiling enabled, separate from getBuildTime so the timing is not disturbed
+void getBuildProfile(const char* name, const std::vector<Line>& lines, double bd) {
+	BuildProfile profile;
+	TrapezoidalMap tm(Point(-bd, -bd), Point(bd, bd));
+	tm.setProfile(&profile);
+	for (const Line& l : lines) {
+		tm.insert(l);
+	}
+	tm.setProfile(NULL);
+	std::cout << name << " build profile\n" << profile;
+}
+
+//query time grouped by the number of internal nodes visited, depths are bucketed by powers of two
+void getQueryAnalysis(const std::vector<Line>& lines, double bd, int queries) {
+	TrapezoidalMap tm(Point(-bd, -bd), Point(bd, bd));
+	for (const Line& l : lines) {
+		tm.insert(l);
+	}
+
+	std::mt19937 gen(12345);
+	std::uniform_real_distribution<double> coord(-bd, bd);
+	std::vector<std::vector<Point>> buckets;
+	std::vector<long long> visited;
+	for (int i = 0; i < queries; i++) {
+		Point pt(coord(gen), coord(gen));
+		int d = tm.queryDepth(pt), b = 0;
+		while ((2 << b) <= d + 1) b++;
+		if ((int)buckets.size() <= b) buckets.resize(b + 1), visited.resize(b + 1);
+		buckets[b].push_back(pt);
+		visited[b] += d;
+	}
+
+	std::cout << "depth\tqueries\tns/query\tns/level\n";
+	size_t sink = 0;
+	for (int b = 0; b < (int)buckets.size(); b++) {
+		const std::vector<Point>& pts = buckets[b];
+		if (pts.empty()) continue;
+		const int repeat = (int)std::max(1LL, 20000000LL / (visited[b] + (long long)pts.size()));
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeat; r++) {
+			for (const Point& pt : pts) sink += (size_t)tm.query(pt);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double, std::nano> ns = end - start;
+		double perQuery = ns.count() / ((double)repeat * pts.size());
+		double avgDepth = (double)visited[b] / pts.size();
+		std::cout << (1 << b) - 1 << '-' << (2 << b) - 2 << '\t' << pts.size() << '\t' << perQuery;
+		std::cout << '\t' << (avgDepth > 0 ? perQuery / avgDepth : 0.0) << '\n';
+	}
+	if (sink == 1) std::cout << '\n'; //keeps the queries from being optimized away
+}
+
+//bench [random size] [adversarial size], also the training workload of the PGO build
+int main(int argc, char** argv) {
+	int randomSize = argc > 1 ? std::atoi(argv[1]) : 20000;
+	int adversarialSize = argc > 2 ? std::atoi(argv[2]) : 3000;
+
+	std::vector<Line> lines;
+	genInput(randomSize, lines);
+	makeInputRandom(lines);
+	getBuildTime("random", lines, 2.0 * randomSize);
+	getBuildProfile("random", lines, 2.0 * randomSize);
+	getQueryAnalysis(lines, 2.0 * randomSize, 100000);
+
+	lines.clear();
+	genInput(adversarialSize, lines);
+	makeInputAdversarial_sorting(lines);
+	getBuildTime("adversarial", lines, 2.0 * adversarialSize);
+	getBuildProfile("adversarial", lines, 2.0 * adversarialSize);
+	getQueryAnalysis(lines, 2.0 * adversarialSize, 100000);
+	return 0;
+}
@@ -4,6 +4,10 @@
 static std::random_device rd;
 static std::mt19937 mt(rd());
 
+void seedInput(unsigned seed) {
+	mt.seed(seed);
+}
+
 void makeInputRandom(std::vector<Line>& l) {
 	std::shuffle(l.begin(), l.end(), mt);
 }
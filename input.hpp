@@ -8,6 +8,7 @@
 void makeInputRandom(std::vector<Line>& l);
 void makeInputAdversarial_sorting(std::vector<Line>& l);
 void genInput(int size, std::vector<Line>& l);
+void seedInput(unsigned seed); //makes genInput and makeInputRandom reproducible
 
 
 //stdin/stdout
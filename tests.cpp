@@ -0,0 +1,392 @@
+#include "trapezoidalMap.hpp"
+#include "input.hpp"
+#include "tiledMap.hpp"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifndef TESTCASE_DIR
+#define TESTCASE_DIR "testcase"
+#endif
+
+static std::string trimRight(std::string s) {
+	while (!s.empty() && std::isspace((unsigned char)s.back())) s.pop_back();
+	return s;
+}
+
+//queries pts and compares the printed trapezoids with testcase/ans/<ans>
+int test(const std::vector<Line>& lines, const std::vector<Point>& pts, double bd, const char* ans) {
+	TrapezoidalMap tm(Point(-bd, -bd),Point(bd,bd));
+	for (const Line& l : lines) {
+		tm.insert(l);
+	}
+	std::ostringstream out;
+	for (const Point& pt : pts) {
+		auto trapezoid = tm.query(pt);
+		out << "query point : " << pt << '\n';
+		out << *trapezoid << "\n\n";
+	}
+
+	std::string path = std::string(TESTCASE_DIR) + "/ans/" + ans;
+	std::ifstream in(path);
+	std::stringstream expected;
+	expected << in.rdbuf();
+	if (!in || trimRight(expected.str()) != trimRight(out.str())) {
+		std::cout << ans << " : FAIL\n" << out.str();
+		return 1;
+	}
+	std::cout << ans << " : ok (max depth " << tm.maxDepth() << ")\n";
+	return 0;
+}
+
+int testcase1()
+{
+	std::vector<Line> lines;
+	std::vector<Point> pts;
+
+	for (int i = 9000; i > 0; i -= 10) {
+		lines.push_back(Line(Point(-i, i), Point(i, i)));
+	}
+
+	pts.push_back(Point(0, 55));
+	pts.push_back(Point(55, 55));
+	pts.push_back(Point(0, -55));
+	pts.push_back(Point(75, 20));
+	
+	return test(lines, pts, 10000, "ans1.txt");
+}
+
+int testcase2()
+{
+	std::vector<Line> lines;
+
+	lines.push_back(Line(Point(-4, 2), Point(0, 4)));
+	lines.push_back(Line(Point(-5, -2), Point(2, 0)));
+	lines.push_back(Line(Point(-2, 1), Point(6, 2)));
+
+	std::vector<Point> pts = { Point(-1,0), Point(4,0),Point(-2,6) };
+
+	return test(lines, pts, 100, "ans2.txt");
+}
+
+int testcase3()
+{
+	std::vector<Line> lines;
+
+	lines.push_back(Line(Point(-8, 10), Point(9, 10)));
+	lines.push_back(Line(Point(-11, 3), Point(0, 3)));
+	lines.push_back(Line(Point(4, 3), Point(13, 3)));
+	lines.push_back(Line(Point(-4,7), Point(6, 7)));
+	lines.push_back(Line(Point(-13, 5), Point(17, 5)));
+	lines.push_back(Line(Point(15, 7), Point(18, 7)));
+
+	std::vector<Point> pts;
+	pts.push_back({ -6,1 });
+	pts.push_back({ -1,6 });
+	pts.push_back({ 5,8 });
+	pts.push_back({ 16,6 });
+
+	return test(lines, pts, 100, "ans3.txt");
+}
+
+
+int testcase4()
+{
+	std::vector<Line> lines;
+
+	lines.push_back(Line({ {-8,8}, {8,8} }));
+	lines.push_back(Line({ {-1,7}, {10,7} }));
+	lines.push_back(Line({ {7,5}, {14,5} }));
+	lines.push_back(Line({ {-4,4}, {1,4} }));
+	lines.push_back(Line({ {-3,3}, {11,3} }));
+	lines.push_back(Line({ {-11,5}, {12,-6} }));
+	lines.push_back(Line({ {-12,-2}, {-2,-2} }));
+	lines.push_back(Line({ {-4,-3}, {3,-3} }));
+	lines.push_back(Line({ {-10,-4}, {4,-4} }));
+
+	std::vector<Point> pts;
+	pts.push_back({ -12.5,10.5 });
+	pts.push_back({ 10.5,9.5 });
+	pts.push_back({ 1.5,8.5 });
+	pts.push_back({ 7.5,7.5 });
+	pts.push_back({ -7.5,5.5 });
+	pts.push_back({ 9.5,5.5 });
+	pts.push_back({ -1.5,5});
+	pts.push_back({ 0.5,3.5 });
+	pts.push_back({ 6.5,3.5 });
+	pts.push_back({ 9.5,2.5 });
+	pts.push_back({ -0.5,1.5 });
+	pts.push_back({ 11.5,1.5 });
+	pts.push_back({ -5,1 });
+	pts.push_back({ 0,-2 });
+	pts.push_back({ -7.5,-3.5 });
+	pts.push_back({ -0.5,-3.5 });
+	pts.push_back({ 5.5,-5.5 });
+
+	return test(lines, pts, 100, "ans4.txt");
+
+}
+
+
+
+static bool sameTrapezoid(const Trapezoid* a, const Trapezoid* b) {
+	return a->top.pl.isSame(b->top.pl) && a->top.pr.isSame(b->top.pr)
+		&& a->bottom.pl.isSame(b->bottom.pl) && a->bottom.pr.isSame(b->bottom.pr)
+		&& a->leftp.isSame(b->leftp) && a->rightp.isSame(b->rightp);
+}
+
+//the only trapezoid of tm containing pt, found without the search structure
+static Trapezoid* bruteForce(const TrapezoidalMap& tm, const Point& pt) {
+	std::vector<LeafNode*> all;
+	tm.leaves(all);
+	Trapezoid* found = NULL;
+	for (LeafNode* leaf : all) {
+		if (!leaf->t->isInside(pt)) continue;
+		if (found != NULL) return NULL;
+		found = leaf->t;
+	}
+	return found;
+}
+
+//nearest segment strictly above (dir 1) or below (dir -1) pt among lines, NULL if there is none
+static const Line* bruteForceVisible(const std::vector<Line>& lines, const Point& pt, int dir) {
+	const Line* best = NULL;
+	for (const Line& l : lines) {
+		if (!l.pl.isLeft(pt) || !pt.isLeft(l.pr)) continue;
+		double y = l.yAt(pt.x);
+		if ((y - pt.y) * dir <= 0) continue;
+		if (best == NULL || (y - best->yAt(pt.x)) * dir < 0) best = &l;
+	}
+	return best;
+}
+
+static bool sameSegment(const Line* a, const Line* b) {
+	if (a == NULL || b == NULL) return a == b;
+	return a->pl.isSame(b->pl) && a->pr.isSame(b->pr);
+}
+
+/*
+Builds a map from genInput segments checking the invariants after every insert,
+then compares query, a copy of a half built map, a map assigned from it and TiledTrapezoidalMap
+with the brute force answer at random points. Vertical visibility is compared with a scan of all segments
+and the exported decomposition with the trapezoids of the map.
+*/
+int fuzzcase(unsigned seed) {
+	std::mt19937 gen(seed);
+	seedInput(seed);
+	int size = std::uniform_int_distribution<int>(1, 100)(gen);
+	double bd = size + 1;
+	std::vector<Line> lines;
+	genInput(size, lines);
+	if (seed % 2 == 0) makeInputAdversarial_sorting(lines);
+
+	std::string error;
+	TrapezoidalMap tm(Point(-bd, -bd), Point(bd, bd));
+	for (const Line& l : lines) {
+		tm.insert(l);
+		if (!tm.checkInvariants(error)) {
+			std::cout << "fuzz seed " << seed << " : FAIL after inserting " << l << '\n' << error;
+			return 1;
+		}
+	}
+
+	TrapezoidalMap half(Point(-bd, -bd), Point(bd, bd));
+	for (size_t i = 0; i < lines.size() / 2; i++) half.insert(lines[i]);
+	TrapezoidalMap copy(half);
+	for (size_t i = lines.size() / 2; i < lines.size(); i++) copy.insert(lines[i]);
+	//assigned an empty map whose root is a leaf, then a built one
+	TrapezoidalMap assigned(Point(-1, -1), Point(1, 1));
+	assigned = TrapezoidalMap(Point(-bd, -bd), Point(bd, bd));
+	assigned.insert(lines[0]);
+	assigned = half;
+	for (size_t i = lines.size() / 2; i < lines.size(); i++) assigned.insert(lines[i]);
+	if (!half.checkInvariants(error) || !copy.checkInvariants(error) || !assigned.checkInvariants(error)) {
+		std::cout << "fuzz seed " << seed << " : FAIL in a copy\n" << error;
+		return 1;
+	}
+
+	//a small budget so that tiles are evicted and rebuilt, half of the segments go through reopened files
+	const size_t budget = 64 * 1024;
+	{
+		TiledTrapezoidalMap created(Point(-bd, -bd), Point(bd, bd), 4, ".", budget, TILES_CREATE);
+		for (size_t i = 0; i < lines.size() / 2; i++) created.insert(lines[i]);
+	}
+	TiledTrapezoidalMap tiled(Point(-bd, -bd), Point(bd, bd), 4, ".", budget, TILES_OPEN);
+	for (size_t i = lines.size() / 2; i < lines.size(); i++) {
+		tiled.query(lines[i].pl);
+		tiled.insert(lines[i]);
+		if (tiled.residentBytes() > budget && tiled.residentTiles() > 1) {
+			std::cout << "fuzz seed " << seed << " : FAIL tiled map is over its budget\n";
+			return 1;
+		}
+	}
+
+	std::uniform_real_distribution<double> coord(-bd, bd);
+	for (int i = 0; i < 200; i++) {
+		Point pt(coord(gen), coord(gen));
+		Trapezoid* expected = bruteForce(tm, pt);
+		const char* failed = NULL;
+		if (expected == NULL) failed = "brute force";
+		else if (tm.query(pt) != expected) failed = "query";
+		else if (!sameTrapezoid(copy.query(pt), expected)) failed = "copy";
+		else if (!sameTrapezoid(assigned.query(pt), expected)) failed = "assigned copy";
+		else if (!sameSegment(tm.segmentAbove(pt), bruteForceVisible(lines, pt, 1))) failed = "segment above";
+		else if (!sameSegment(tm.segmentBelow(pt), bruteForceVisible(lines, pt, -1))) failed = "segment below";
+		else if (!sameSegment(tiled.segmentAbove(pt), tm.segmentAbove(pt))) failed = "tiled segment above";
+		else if (!sameSegment(tiled.segmentBelow(pt), tm.segmentBelow(pt))) failed = "tiled segment below";
+		else {
+			Trapezoid* t = tiled.query(pt);
+			if (!t->top.pl.isSame(expected->top.pl) || !t->top.pr.isSame(expected->top.pr)
+				|| !t->bottom.pl.isSame(expected->bottom.pl) || !t->bottom.pr.isSame(expected->bottom.pr)) failed = "tiled";
+		}
+		if (failed != NULL) {
+			std::cout << "fuzz seed " << seed << " : FAIL " << failed << " at " << pt << '\n';
+			return 1;
+		}
+	}
+
+	size_t count = 0;
+	double area = 0;
+	std::set<const Trapezoid*> walked;
+	tm.forEachTrapezoid([&](const Trapezoid& t) { count++; area += t.area(); walked.insert(&t); });
+	std::vector<LeafNode*> all;
+	tm.leaves(all);
+	bool complete = walked.size() == count && count == all.size();
+	for (LeafNode* leaf : all) complete = complete && walked.count(leaf->t) == 1;
+	std::stringstream exported;
+	tm.exportDecomposition(exported);
+	size_t exportedCount = 0;
+	double exportedArea = 0, v[12];
+	exported >> exportedCount;
+	for (size_t i = 0; i < exportedCount; i++) {
+		for (double& x : v) exported >> x;
+		Trapezoid t(Line(Point(v[0], v[1]), Point(v[2], v[3])), Line(Point(v[4], v[5]), Point(v[6], v[7])), Point(v[8], v[9]), Point(v[10], v[11]));
+		exportedArea += t.area();
+	}
+	double box = 4 * bd * bd;
+	if (!complete || !exported || count != exportedCount || std::abs(area - box) > 1e-9 * box || std::abs(exportedArea - box) > 1e-9 * box) {
+		std::cout << "fuzz seed " << seed << " : FAIL export of " << count << " trapezoids\n";
+		return 1;
+	}
+	for (int i = 0; i < 4; i++) std::remove(("./tile" + std::to_string(i) + ".bin").c_str());
+	return 0;
+}
+
+//the answers of v at pt match a scan of the segments inserted before v was pinned
+static bool checkVersion(const MapVersion& v, const std::vector<Line>& lines, const Point& pt) {
+	std::vector<Line> inserted(lines.begin(), lines.begin() + v.number());
+	return v.query(pt)->isInside(pt)
+		&& sameSegment(v.segmentAbove(pt), bruteForceVisible(inserted, pt, 1))
+		&& sameSegment(v.segmentBelow(pt), bruteForceVisible(inserted, pt, -1));
+}
+
+/*
+Pins a version before the first insert and after every insert, releasing some of them while the map grows
+so that the replaced leaves are freed in between, while a reader thread keeps pinning and querying the newest version.
+Every version, the reader's during the build and the kept ones after it, is compared with a scan of its segments.
+*/
+int versioncase(unsigned seed) {
+	std::mt19937 gen(seed);
+	seedInput(seed);
+	int size = std::uniform_int_distribution<int>(1, 1000)(gen);
+	double bd = size + 1;
+	std::vector<Line> lines;
+	genInput(size, lines);
+	if (seed % 2 == 0) makeInputAdversarial_sorting(lines);
+
+	TrapezoidalMap tm(Point(-bd, -bd), Point(bd, bd));
+	std::atomic<bool> started(false), done(false);
+	int readerFailed = 0;
+	std::thread reader([&]() {
+		std::mt19937 rgen(seed + 1);
+		std::uniform_real_distribution<double> rcoord(-bd, bd);
+		do {
+			MapVersion v(tm);
+			started = true;
+			std::this_thread::yield(); //lets the writer insert past v before it is queried, on a single core too
+			for (int i = 0; i < 4; i++) {
+				if (!checkVersion(v, lines, Point(rcoord(rgen), rcoord(rgen)))) readerFailed++;
+			}
+		} while (!done.load());
+	});
+	while (!started.load()) std::this_thread::yield();
+
+	std::vector<MapVersion*> kept(1, new MapVersion(tm));
+	for (size_t i = 0; i < lines.size(); i++) {
+		tm.insert(lines[i]);
+		std::this_thread::yield();
+		kept.push_back(new MapVersion(tm));
+		if (i % 2 == 1) { //released while younger versions stay pinned
+			delete kept[i];
+			kept[i] = NULL;
+		}
+		if (i == lines.size() / 2) {
+			delete kept[0];
+			kept[0] = NULL;
+		}
+	}
+	done = true;
+	reader.join();
+
+	std::string error;
+	int failed = readerFailed;
+	if (!tm.checkInvariants(error)) failed++;
+	std::uniform_real_distribution<double> coord(-bd, bd);
+	for (size_t k = 0; k < kept.size(); k++) {
+		if (kept[k] == NULL) continue;
+		if (kept[k]->number() != k) failed++;
+		for (int i = 0; i < 20; i++) {
+			if (!checkVersion(*kept[k], lines, Point(coord(gen), coord(gen)))) failed++;
+		}
+		delete kept[k];
+	}
+	if (failed != 0) {
+		std::cout << "versions seed " << seed << " : FAIL " << failed << " answers of pinned versions (" << readerFailed << " by the reader)\n" << error;
+		return 1;
+	}
+	return 0;
+}
+
+//tests [testcases] [fuzz <rounds> <first seed>] [versions <rounds> <first seed>]
+int main(int argc, char** argv) {
+	bool all = argc == 1;
+	int failed = 0;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "testcases") == 0) all = true;
+	}
+	if (all) {
+		failed += testcase1();
+		failed += testcase2();
+		failed += testcase3();
+		failed += testcase4();
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "fuzz") != 0) continue;
+		int rounds = i + 1 < argc ? std::atoi(argv[i + 1]) : 200;
+		unsigned seed = i + 2 < argc ? (unsigned)std::atoi(argv[i + 2]) : 1;
+		int fuzzFailed = 0;
+		for (int r = 0; r < rounds; r++) fuzzFailed += fuzzcase(seed + r);
+		std::cout << "fuzz : " << rounds - fuzzFailed << " / " << rounds << " ok\n";
+		failed += fuzzFailed;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "versions") != 0) continue;
+		int rounds = i + 1 < argc ? std::atoi(argv[i + 1]) : 20;
+		unsigned seed = i + 2 < argc ? (unsigned)std::atoi(argv[i + 2]) : 1;
+		int versionsFailed = 0;
+		for (int r = 0; r < rounds; r++) versionsFailed += versioncase(seed + r);
+		std::cout << "versions : " << rounds - versionsFailed << " / " << rounds << " ok\n";
+		failed += versionsFailed;
+	}
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#ifndef __TILED_MAP_H__
+#define __TILED_MAP_H__
+
+#include "trapezoidalMap.hpp"
+#include <list>
+#include <string>
+
+
+/*
+Tiled map for segment sets that are too large to keep in memory as one TrapezoidalMap.
+The bounding box is cut into equal width x-slabs, every tile keeps the segments crossing its slab
+in a file ( 4 doubles per segment, in insertion order ) and its map is rebuilt from that file on demand.
+Built maps are kept in an LRU cache whose estimated size stays under memoryBudget bytes.
+
+Segments are stored unclipped, so top and bottom of a returned trapezoid are the same as in the untiled map,
+leftp and rightp are only exact inside the slab of the query point.
+
+Tile files are named dir/tile<i>.bin. With TILES_SCRATCH they are truncated on construction and removed on destruction,
+TILES_CREATE truncates and keeps them, TILES_OPEN reuses the files of an earlier TILES_CREATE or TILES_OPEN map.
+The files hold no header, a reopened map must be given the same box and tile count they were written with.
+*/
+enum TileFiles { TILES_SCRATCH, TILES_CREATE, TILES_OPEN };
+
+struct TiledTrapezoidalMap {
+	TiledTrapezoidalMap(const Point& bottomLeft, const Point& topRight, int tiles, const std::string& dir, size_t memoryBudget,
+		TileFiles files = TILES_SCRATCH);
+	~TiledTrapezoidalMap();
+	void insert(const Line& l);
+	void sync(); //writes buffered segments to the tile files
+	Trapezoid* query(const Point& p); //valid until the next call of query or insert
+	const Line* segmentAbove(const Point& p); //same as TrapezoidalMap::segmentAbove, valid as long as query
+	const Line* segmentBelow(const Point& p);
+	int tileOf(double x) const;
+	int residentTiles() const;
+	size_t residentBytes() const;
+
+private:
+	struct Tile {
+		std::string path;
+		size_t segments; //written to the file and pending
+		std::vector<Line> pending; //not written to the file yet
+		TrapezoidalMap* map; //NULL if not resident
+		std::list<int>::iterator lru;
+	};
+
+	Point bl, tr;
+	TileFiles files;
+	double width;
+	size_t budget, resident, pendingSegments;
+	std::vector<Tile> tiles;
+	std::list<int> lru; //front is the most recently used tile
+
+	TiledTrapezoidalMap(const TiledTrapezoidalMap&);
+	TiledTrapezoidalMap& operator=(const TiledTrapezoidalMap&);
+	void flush(Tile& tile);
+	void flushAll();
+	TrapezoidalMap* load(int i);
+	void evict(int i);
+	void shrink(int keep, size_t extra);
+	static size_t estimateBytes(size_t segments);
+};
+
+#endif
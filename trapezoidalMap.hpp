@@ -2,13 +2,17 @@
 #define __TRAPEZOIDAL_MAP_H__
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <vector>
 #include <iostream>
 #include <set>
+#include <mutex>
 #include <cassert>
 #include <queue>
 #include <map>
+#include <unordered_map>
+#include <string>
 
 
 /*
@@ -25,12 +29,13 @@ struct Point;
 struct Line;
 struct TNode;
 struct Trapezoid;
+struct MapVersion;
 
 struct Point {
 	double x, y;
 	Point() : x(0.0), y(0.0) {};
 	Point(double x, double y) : x(x), y(y) {};
-	bool isLeft(const Point& p) const; //this point is lefter than p
+	bool isLeft(const Point& p) const { return x < p.x; } //this point is lefter than p
 	bool isSame(const Point& p) const;
 
 	friend Point operator-(const Point& p1, const Point& p2);
@@ -46,8 +51,11 @@ struct Line {
 	Line(const Point& pl, const Point& pr);
 	Line(const Line& l) : pl(l.pl), pr(l.pr) {};
 	friend std::ostream& operator<<(std::ostream& o, const Line& l);
-	bool isUpper(const Point& p) const;//this line is upper than p
+	bool isUpper(const Point& p) const {//this line is upper than p
+		return ((pr.x - pl.x) * (p.y - pl.y) - (pr.y - pl.y) * (p.x - pl.x)) < eps;
+	}
 	bool IsPtEndpoint(const Point& p) const;
+	double yAt(double x) const;
 };
 
 struct Trapezoid {
@@ -60,58 +68,175 @@ struct Trapezoid {
 
 	Trapezoid(Line top, Line bottom, Point leftp, Point rightp);
 	friend std::ostream& operator<<(std::ostream& o, const Trapezoid& t);
-	bool isInside(const Point& pt);
+	bool isInside(const Point& pt) const;
+	double area() const;
 	void updateLeftTrapezoid(Trapezoid* prv, Trapezoid* cur);
 	void updateRightTrapezoid(Trapezoid* prv, Trapezoid* cur);
 };
 
+//node kind is stored as a tag instead of a vtable so the descent loop can be inlined
+enum NodeType { XNODE, YNODE, LEAFNODE };
+
+//an edge of the search structure, atomic so that pinned versions can be queried while insert rewires it
+typedef std::atomic<TNode*> NodeSlot;
+
 struct TNode {
-	TNode* lc, * rc;
-	virtual bool isLeaf() const = 0;
-	virtual TNode* query(const Point& pt) = 0;
+	NodeSlot child[2]; //child[0] is taken when the test of the node fails, child[1] when it holds
+	NodeType type;
+	//set on a node put in the place of a leaf : versions before `version` still see the leaf `replaced`
+	unsigned version;
+	TNode* replaced;
+	TNode(NodeType type) : child(), type(type), version(0), replaced(NULL) {}
+	bool isLeaf() const { return type == LEAFNODE; }
+	TNode* query(const Point& pt) const;
+	static void destroy(TNode* node); //delete through the concrete type
 };
 
 struct XNode : TNode{
 	Point p;
-	XNode(Point p) : p(p) {}
-	virtual bool isLeaf() const;
-	virtual TNode* query(const Point& pt);
+	XNode(Point p) : TNode(XNODE), p(p) {}
+	TNode* query(const Point& pt) const { return child[p.isLeft(pt)]; }
 };
 
 struct YNode : TNode {
 	Line l;
-	YNode(Line l) : l(l) {}
-	virtual bool isLeaf() const;
-	virtual TNode* query(const Point& pt);
+	YNode(Line l) : TNode(YNODE), l(l) {}
+	TNode* query(const Point& pt) const { return child[l.isUpper(pt)]; }
 };
 
 struct LeafNode : TNode {
-	std::vector<TNode **> parents; //at most 4 parents (from top,bottom, leftp, rightp)
+	std::vector<NodeSlot*> parents; //every edge into this leaf, one per trapezoid it replaced when merged along a segment
 	Trapezoid* t;
 
 	LeafNode(Trapezoid* t);
-	virtual bool isLeaf() const;
-	virtual TNode* query(const Point& pt);
+};
+
+inline TNode* TNode::query(const Point& pt) const {
+	switch (type) {
+	case XNODE: return ((const XNode*)this)->query(pt);
+	case YNODE: return ((const YNode*)this)->query(pt);
+	default: return (TNode*)this;
+	}
+}
+
+/*
+Counters of TrapezoidalMap::insert, collected only while a profile is attached with setProfile.
+Cycles come from the time stamp counter on x86 and are nanoseconds elsewhere.
+*/
+struct BuildProfile {
+	unsigned long long queryCycles; //locating the left endpoint
+	unsigned long long walkCycles; //following the segment with nextTrapezoid
+	unsigned long long splitCycles; //insert_* without rewiring : new trapezoids, neighbor links, new nodes
+	unsigned long long rewireCycles; //redirecting the parents of replaced leaves
+	unsigned long long segments;
+	unsigned long long trapezoidAllocs, nodeAllocs;
+	std::vector<int> crossed; //trapezoids crossed by each segment, the k of O(k + log n)
+
+	BuildProfile();
+	int maxCrossed() const;
+	double avgCrossed() const;
+	friend std::ostream& operator<<(std::ostream& o, const BuildProfile& p);
 };
 
 struct TrapezoidalMap {
-	TNode* root;
+	NodeSlot root;
+	BuildProfile* profile; //NULL unless profiling
+	Point bottomLeft, topRight;
+	std::atomic<unsigned> version; //number of inserts, see MapVersion
 
 
 	TrapezoidalMap(const Point& bottomLeft, const Point& topRight);
+	TrapezoidalMap(const TrapezoidalMap& o); //deep copy, the copy shares nothing with o
+	//assignment and swap replace the whole structure, no version of either map may be pinned
+	TrapezoidalMap& operator=(const TrapezoidalMap& o);
+	void swap(TrapezoidalMap& o);
 	Trapezoid* query(const Point& p);
+	const Trapezoid* query(const Point& p) const; //a const map only hands out const trapezoids
+	//vertical visibility : first segment hit by a vertical ray from p, NULL if the ray reaches the bounding box
+	//the pointer is valid until the next insert
+	const Line* segmentAbove(const Point& p) const;
+	const Line* segmentBelow(const Point& p) const;
+	bool isBoundary(const Line& l) const; //l is the top or bottom side of the bounding box
+	template <class F> void forEachTrapezoid(F f) const; //f(const Trapezoid&) once per trapezoid, left to right along neighbor links
+	void exportDecomposition(std::ostream& o) const;
 	void insert(const Line& l);
-	int maxDepth();
+	int maxDepth() const;
+	int queryDepth(const Point& p) const; //number of internal nodes visited by query(p)
+	void setProfile(BuildProfile* p); //NULL to stop profiling, the profile is not owned
+	void nodes(std::vector<TNode*>& out) const;
+	void leaves(std::vector<LeafNode*>& out) const;
+	bool checkInvariants(std::string& error) const; //false with a description of the first broken invariant
 	~TrapezoidalMap();
 
 private:
+	friend struct MapVersion;
+	std::mutex pinLock; //guards pins, the only part of the map that readers write
+	std::multiset<unsigned> pins;
+	std::vector<std::pair<unsigned, LeafNode*>> retired; //leaves replaced by the insert making the version, with their trapezoids
+
+	unsigned pin();
+	void unpin(unsigned v);
+	void retire(LeafNode* leaf);
+	void reclaim();
+	void copyFrom(const TrapezoidalMap& o);
+	void clear();
+	const Trapezoid* leftmost() const;
 	void insert_two_segment_endpoint(Trapezoid* trapezoid, const Line& l);
 	void insert_left_endpoint(Trapezoid* trapezoid, const Line& l, Trapezoid*& Y, Trapezoid*& Z);
 	void insert_no_segment_endpoint(Trapezoid* trapezoid, const Line& l, Trapezoid*& Y, Trapezoid*& Z);
 	void insert_right_endpint(Trapezoid* trapezoid, const Line& l, Trapezoid*& Y, Trapezoid*& Z);
-	LeafNode* queryNode(const Point& p);
+	LeafNode* queryNode(const Point& p) const;
+	void replaceLeaf(LeafNode* leaf, TNode* node);
+	void lap(unsigned long long BuildProfile::* phase, unsigned long long& mark);
+	void countAllocs(int trapezoids, int nodes);
 	Trapezoid* nextTrapezoid(Trapezoid* trapezoid, const Line& l);
 };
 
+/*
+A version of a TrapezoidalMap pinned by a reader : the map as it was after its first number() inserts.
+Versions share every node and trapezoid, an insert keeps the leaves and trapezoids it replaces only until
+no version older than it is pinned, so an update costs the region it touches and not a copy of the map.
+One thread may insert into the map while any number of threads query their own pinned versions without locks.
+The geometry of a returned trapezoid is that of the version, its neighbor links are those of the newest
+version and are only for the inserting thread. A version must be released before its map is destroyed.
+*/
+struct MapVersion {
+	explicit MapVersion(TrapezoidalMap& map); //pins the newest version
+	~MapVersion();
+	unsigned number() const { return version; }
+	const Trapezoid* query(const Point& p) const;
+	const Line* segmentAbove(const Point& p) const;
+	const Line* segmentBelow(const Point& p) const;
+
+private:
+	TrapezoidalMap& map;
+	unsigned version;
+
+	MapVersion(const MapVersion&);
+	MapVersion& operator=(const MapVersion&);
+};
+
+/*
+Walks the trapezoids from the one at the left side of the box through their right neighbors, in O(n) time.
+Every trapezoid but the leftmost has a left neighbor, a trapezoid is entered only from its canonical one
+( lowerleft, or upperleft if lowerleft is NULL ) so no visited set is needed.
+The only extra memory is the stack of entered but unvisited trapezoids.
+*/
+template <class F>
+void TrapezoidalMap::forEachTrapezoid(F f) const {
+	std::vector<const Trapezoid*> stack(1, leftmost());
+	while (!stack.empty()) {
+		const Trapezoid* t = stack.back();
+		stack.pop_back();
+		f(*t);
+		const Trapezoid* right[2] = { t->upperright, t->lowerright };
+		for (int i = 0; i < 2; i++) {
+			const Trapezoid* n = right[i];
+			if (n == NULL || (i == 1 && n == right[0])) continue;
+			if ((n->lowerleft != NULL ? n->lowerleft : n->upperleft) == t) stack.push_back(n);
+		}
+	}
+}
+
 
 #endif
\ No newline at end of file